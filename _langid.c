@@ -15,18 +15,27 @@ static char module_docstring[] =
     "This module provides an off-the-shelf language identifier.";
 static char identify_docstring[] =
     "Identify the language of a piece of text.";
+static char enable_cache_docstring[] =
+    "Cache results for up to the given number of distinct inputs.";
+static char cache_stats_docstring[] =
+    "Return a (hits, misses) tuple for the result cache.";
 
 /* Available functions */
 static PyObject *langid_identify(PyObject *self, PyObject *args);
+static PyObject *module_enable_cache(PyObject *self, PyObject *args);
+static PyObject *module_cache_stats(PyObject *self, PyObject *args);
 
 /* Module specification */
 static PyMethodDef module_methods[] = {
     {"identify", langid_identify, METH_VARARGS, identify_docstring},
+    {"enable_cache", module_enable_cache, METH_VARARGS, enable_cache_docstring},
+    {"cache_stats", module_cache_stats, METH_NOARGS, cache_stats_docstring},
     {NULL, NULL, 0, NULL}
 };
 
 /* Global LanguageIdentifier instance */
 LanguageIdentifier *identifier;
+LangidResultCache *cache = NULL;
 
 /* Initialize the module */
 PyMODINIT_FUNC init_langid(void)
@@ -35,7 +44,8 @@ PyMODINIT_FUNC init_langid(void)
     if (m == NULL)
         return;
 
-    identifier = get_default_identifier();
+    if ((identifier = get_default_identifier()) == NULL)
+        PyErr_NoMemory();
 }
 
 static PyObject *langid_identify(PyObject *self, PyObject *args)
@@ -56,3 +66,32 @@ static PyObject *langid_identify(PyObject *self, PyObject *args)
     return ret;
 }
 
+static PyObject *module_enable_cache(PyObject *self, PyObject *args)
+{
+    int size;
+
+    if (!PyArg_ParseTuple(args, "i", &size))
+        return NULL;
+
+    if (size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "cache size must be positive");
+        return NULL;
+    }
+
+    /* detach the old cache before replacing it */
+    langid_enable_cache(identifier, NULL);
+    langid_cache_destroy(cache);
+    if ((cache = langid_cache_create(size, NULL)) == NULL)
+        return PyErr_NoMemory();
+    langid_enable_cache(identifier, cache);
+    Py_RETURN_NONE;
+}
+
+static PyObject *module_cache_stats(PyObject *self, PyObject *args)
+{
+    unsigned long hits, misses;
+
+    if (langid_cache_stats(cache, &hits, &misses) != LANGID_OK)
+        hits = misses = 0;
+    return Py_BuildValue("(kk)", hits, misses);
+}
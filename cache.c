@@ -0,0 +1,159 @@
+/* Bounded cache of identification results keyed by a hash of the input.
+ *
+ * The cache is CACHE_WAYS-way set associative: a key can only live in the set
+ * selected by its hash, and within a set entries are evicted using the CLOCK
+ * approximation to LRU (an entry is given a second chance if it has been
+ * referenced since the hand last passed it). Both lookup and insertion are
+ * therefore constant time, and the memory used is fixed at allocation.
+ *
+ * A cache may be shared by identifiers in several threads. Each set is only
+ * touched under the lock for its stripe, so operations on different stripes
+ * proceed in parallel.
+ */
+#include <string.h>
+#include "cache.h"
+
+LangidResultCache *langid_cache_alloc(size_t size){
+    LangidResultCache *c;
+    size_t i;
+    if ( (void *)(c = (LangidResultCache *) malloc(sizeof(LangidResultCache))) == 0 ) return NULL;
+
+    c->num_sets = (size + CACHE_WAYS - 1) / CACHE_WAYS;
+    if (c->num_sets == 0) c->num_sets = 1;
+    c->num_locks = c->num_sets < CACHE_LOCKS ? c->num_sets : CACHE_LOCKS;
+    c->entries = (CacheEntry *) calloc(c->num_sets * CACHE_WAYS, sizeof(CacheEntry));
+    c->hands = (unsigned char *) calloc(c->num_sets, 1);
+    if (posix_memalign((void **) &c->locks, CACHE_LINE, c->num_locks * sizeof(CacheLock)) != 0)
+        c->locks = NULL;
+    if ( c->entries == 0 || c->hands == 0 || c->locks == 0 ) {
+        free(c->entries);
+        free(c->hands);
+        free(c->locks);
+        free(c);
+        return NULL;
+    }
+    memset(c->locks, 0, c->num_locks * sizeof(CacheLock));
+    for (i=0; i < c->num_locks; i++)
+        pthread_mutex_init(&c->locks[i].mutex, NULL);
+
+    return c;
+}
+
+void langid_cache_free(LangidResultCache *c){
+    size_t i;
+    for (i=0; i < c->num_locks; i++)
+        pthread_mutex_destroy(&c->locks[i].mutex);
+    free(c->entries);
+    free(c->hands);
+    free(c->locks);
+    free(c);
+}
+
+static inline uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+/* 64-bit hash of a byte string, based on the body and finalizer of
+ * MurmurHash3. Input is consumed a word at a time so that hashing stays
+ * cheap relative to tokenizing the same text. Different seeds give
+ * unrelated hashes of the same text.
+ */
+uint64_t langid_hash_bytes(const char *text, size_t len, uint64_t seed){
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h = seed ^ len, k;
+    size_t i;
+
+    for (i=0; i + 8 <= len; i += 8){
+        memcpy(&k, text + i, 8);
+        k *= c1; k = rotl64(k, 31); k *= c2;
+        h ^= k;
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+    }
+
+    if (i < len) {
+        k = 0;
+        memcpy(&k, text + i, len - i);
+        k *= c1; k = rotl64(k, 31); k *= c2;
+        h ^= k;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+int langid_cache_lookup(LangidResultCache *c, uint64_t key, unsigned len, int *value, double *score){
+    size_t index = key % c->num_sets;
+    CacheEntry *set = &c->entries[index * CACHE_WAYS];
+    CacheLock *lock = &c->locks[index % c->num_locks];
+    int i, found = 0;
+
+    pthread_mutex_lock(&lock->mutex);
+    for (i=0; i < CACHE_WAYS; i++){
+        if (set[i].used && set[i].key == key && set[i].len == len) {
+            set[i].referenced = 1;
+            *value = set[i].value;
+            *score = set[i].score;
+            found = 1;
+            break;
+        }
+    }
+    if (found) lock->hits++;
+    else lock->misses++;
+    pthread_mutex_unlock(&lock->mutex);
+
+    return found;
+}
+
+void langid_cache_insert(LangidResultCache *c, uint64_t key, unsigned len, int value, double score){
+    size_t index = key % c->num_sets;
+    CacheEntry *set = &c->entries[index * CACHE_WAYS];
+    CacheLock *lock = &c->locks[index % c->num_locks];
+    unsigned i;
+
+    pthread_mutex_lock(&lock->mutex);
+
+    /* another thread may have inserted the same input since our lookup */
+    for (i=0; i < CACHE_WAYS; i++){
+        if (set[i].used && set[i].key == key && set[i].len == len) {
+            pthread_mutex_unlock(&lock->mutex);
+            return;
+        }
+    }
+
+    /* advance the hand, clearing reference bits, until an unreferenced entry
+     * is found. this terminates within two passes of the set.
+     */
+    i = c->hands[index];
+    while (set[i].used && set[i].referenced) {
+        set[i].referenced = 0;
+        i = (i + 1) % CACHE_WAYS;
+    }
+
+    set[i].key = key;
+    set[i].len = len;
+    set[i].value = value;
+    set[i].score = score;
+    set[i].used = 1;
+    set[i].referenced = 0;
+    c->hands[index] = (i + 1) % CACHE_WAYS;
+
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+/* Total the hit and miss counts over all stripes */
+void langid_cache_counts(LangidResultCache *c, unsigned long *hits, unsigned long *misses){
+    size_t i;
+
+    *hits = *misses = 0;
+    for (i=0; i < c->num_locks; i++){
+        pthread_mutex_lock(&c->locks[i].mutex);
+        *hits += c->locks[i].hits;
+        *misses += c->locks[i].misses;
+        pthread_mutex_unlock(&c->locks[i].mutex);
+    }
+}
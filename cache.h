@@ -0,0 +1,52 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "liblangid.h"
+
+#define CACHE_WAYS 4
+
+/* maximum number of locks guarding the sets of a cache. set i is guarded
+ * by lock i % num_locks, so threads only contend when they hit the same
+ * stripe.
+ */
+#define CACHE_LOCKS 64
+
+typedef struct {
+    uint64_t key;
+    unsigned len;
+    int value;
+    double score;
+    unsigned char used;
+    unsigned char referenced;
+} CacheEntry;
+
+#define CACHE_LINE 64
+
+/* lock for a stripe of sets, with the hit and miss counts for the stripe so
+ * that updating them needs no further synchronization. each lock has a cache
+ * line to itself, so threads working on different stripes do not contend.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    unsigned long hits;
+    unsigned long misses;
+} __attribute__((aligned(CACHE_LINE))) CacheLock;
+
+struct LangidResultCache {
+    size_t num_sets;
+    size_t num_locks;
+    CacheEntry *entries;
+    unsigned char *hands;
+    CacheLock *locks;
+};
+
+extern LangidResultCache *langid_cache_alloc(size_t size);
+extern void langid_cache_free(LangidResultCache *c);
+extern uint64_t langid_hash_bytes(const char *text, size_t len, uint64_t seed);
+extern int langid_cache_lookup(LangidResultCache *c, uint64_t key, unsigned len, int *value, double *score);
+extern void langid_cache_insert(LangidResultCache *c, uint64_t key, unsigned len, int value, double score);
+extern void langid_cache_counts(LangidResultCache *c, unsigned long *hits, unsigned long *misses);
+
+#endif
@@ -3,6 +3,7 @@
  *
  * Marco Lui <saffsd@gmail.com>, September 2014
  */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,11 +11,52 @@
 #include <ctype.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 #include "liblangid.h"
 
 const char* no_file = "NOSUCHFILE";
 const char* not_file = "NOTAFILE";
 
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 
+ * Time identify() on pieces of a sample text of doubling size, scoring them
+ * both directly and via the sparsesets, and report the size below which
+ * direct scoring is faster for this model on this machine.
+ */
+static void calibrate(LanguageIdentifier *lid, char *text, ssize_t textlen){
+    int size, threshold = 0, strategy, p, pieces;
+    double start, elapsed[2];
+
+    printf("size,direct_us,sets_us\n");
+    for (size = 8; size <= textlen && size <= 65536; size *= 2) {
+      /* process about 1MB of text per strategy and size */
+      pieces = (1 << 20) / size;
+      for (strategy = 0; strategy < 2; strategy++) {
+        langid_set_direct_threshold(lid, strategy ? 0 : size + 1);
+        start = now();
+        for (p = 0; p < pieces; p++) {
+          identify(lid, text + (ssize_t) p * size % (textlen - size + 1), size);
+        }
+        elapsed[strategy] = (now() - start) / pieces;
+      }
+      printf("%d,%.3f,%.3f\n", size, elapsed[0] * 1e6, elapsed[1] * 1e6);
+      if (!threshold && elapsed[1] <= elapsed[0]) threshold = size;
+    }
+    if (!threshold) threshold = size;
+
+    printf("recommended: -T %d\n", threshold);
+}
+
 
 int main(int argc, char **argv){
     const char* lang;
@@ -22,13 +64,28 @@ int main(int argc, char **argv){
     ssize_t pathlen, textlen;
     char *path = NULL, *text = NULL; /* NULL init required for use with getline/getdelim*/
     LanguageIdentifier *lid;
+    LangidResultCache *cache = NULL;
+    LangidSpan *spans;
+    int i, num_spans, err;
+    unsigned long hits, misses;
+    double logprob;
+
+    /* for use with -a: cpu to run on, and throughput on it */
+    int cpu = -1;
+    unsigned node = 0;
+    unsigned long docs = 0, bytes = 0;
+    double start, elapsed;
+#ifdef __linux__
+    LanguageIdentifier *shared;
+    cpu_set_t cpus;
+#endif
 
     /* for use while accessing files through mmap*/
     int fd;
 
     /* for use with getopt */
     char *model_path = NULL;
-    int c, l_flag = 0, b_flag = 0;
+    int c, l_flag = 0, b_flag = 0, s_flag = 0, t_flag = 0, p_flag = 0, window = 128, cache_size = 0, threshold = -1;
     opterr = 0;
 
 #ifdef DEBUG
@@ -38,10 +95,17 @@ int main(int argc, char **argv){
     /* valid options are:
      * l: line-mode
      * b: batch-mode
+     * s: segment-mode
+     * w: window size in bytes for segment-mode
      * m: load a model file
+     * c: cache results for this many distinct inputs
+     * t: calibrate the direct scoring threshold on a sample text
+     * T: score texts shorter than this many bytes directly
+     * p: also output the log-probability of the predicted language
+     * a: run on this cpu, with a copy of the model local to its NUMA node
      */
 
-    while ((c = getopt (argc, argv, "lbm:")) != -1) 
+    while ((c = getopt (argc, argv, "lbsw:m:c:tT:pa:")) != -1) 
       switch (c) {
         case 'l':
           l_flag = 1;
@@ -49,11 +113,32 @@ int main(int argc, char **argv){
         case 'b':
           b_flag = 1;
           break;
+        case 's':
+          s_flag = 1;
+          break;
+        case 'w':
+          window = atoi(optarg);
+          break;
         case 'm':
           model_path = optarg;
           break;
+        case 'c':
+          cache_size = atoi(optarg);
+          break;
+        case 't':
+          t_flag = 1;
+          break;
+        case 'T':
+          threshold = atoi(optarg);
+          break;
+        case 'p':
+          p_flag = 1;
+          break;
+        case 'a':
+          cpu = atoi(optarg);
+          break;
         case '?':
-          if (optopt == 'm')
+          if (optopt == 'm' || optopt == 'w' || optopt == 'c' || optopt == 'T' || optopt == 'a')
             fprintf (stderr, "Option -%c requires an argument.\n", optopt);
           else if (isprint (optopt))
             fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -67,18 +152,78 @@ int main(int argc, char **argv){
       }
 
     /* validate getopt options */
-    if (l_flag && b_flag) {
-      fprintf(stderr, "Cannot specify both -l and -b.\n");
+    if (l_flag + b_flag + s_flag + t_flag > 1) {
+      fprintf(stderr, "Can only specify one of -l, -b, -s and -t.\n");
       exit(-1);
     }
+    if (window < 1) {
+      fprintf(stderr, "Window size must be positive.\n");
+      exit(-1);
+    }
+#ifndef __linux__
+    if (cpu >= 0) {
+      fprintf(stderr, "-a is only supported on Linux.\n");
+      exit(-1);
+    }
+#endif
     
     /* load an identifier */
-    lid = model_path ? load_identifier(model_path) : get_default_identifier();
+    err = LANGID_ENOMEM;
+    lid = model_path ? langid_load_identifier(model_path, &err) : get_default_identifier();
+    if (lid == NULL) {
+      fprintf(stderr, "unable to load %s: %s\n", model_path ? model_path : "default model", langid_strerror(err));
+      exit(-1);
+    }
+    /* pin to the requested cpu before replicating the model, so that the
+     * replica is first touched from, and therefore allocated on, its node.
+     * to use every node of a multi-socket host, run one process per node.
+     */
+#ifdef __linux__
+    if (cpu >= 0) {
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        fprintf(stderr, "unable to run on cpu %d.\n", cpu);
+        exit(-1);
+      }
+      syscall(SYS_getcpu, NULL, &node, NULL);
+
+      shared = lid;
+      if ((lid = langid_replicate_identifier(shared, &err)) == NULL) {
+        fprintf(stderr, "unable to replicate model: %s\n", langid_strerror(err));
+        exit(-1);
+      }
+      destroy_identifier(shared);
+    }
+#endif
+
+    if (threshold >= 0) langid_set_direct_threshold(lid, threshold);
+
+    if (t_flag) { /*calibration mode*/
+      textlen = getdelim(&text, &text_size, EOF, stdin);
+      if (textlen < 8) {
+        fprintf(stderr, "Calibration needs at least 8 bytes of sample text.\n");
+        exit(-1);
+      }
+      calibrate(lid, text, textlen);
+      free(text);
+      destroy_identifier(lid);
+      return 0;
+    }
+
+    if (cache_size > 0) {
+      if ((cache = langid_cache_create(cache_size, &err)) == NULL) {
+        fprintf(stderr, "unable to enable cache: %s\n", langid_strerror(err));
+        exit(-1);
+      }
+      langid_enable_cache(lid, cache);
+    }
 
     /* enter appropriate operating mode.
      * we have an interactive mode determined by isatty, and then
-     * the three modes are file-mode (default), line-mode and batch-mode
+     * the four modes are file-mode (default), line-mode, batch-mode and segment-mode
      */
+    start = now();
 
     if (isatty(fileno(stdin))){
       printf("langid.c interactive mode.\n");
@@ -88,6 +233,8 @@ int main(int argc, char **argv){
         textlen = getline(&text, &text_size, stdin);
         if (textlen == 1 || textlen == -1) break; /* -1 for EOF and 1 for only newline */
         lang = identify(lid, text, textlen);
+        docs++;
+        bytes += textlen;
         printf("%s,%zd\n", lang, textlen);
       } 
 
@@ -97,8 +244,11 @@ int main(int argc, char **argv){
     else if (l_flag) { /*line mode*/
 
       while ((textlen = getline(&text, &text_size, stdin)) != -1){
-        lang = identify(lid, text, textlen);
-        printf("%s,%zd\n", lang, textlen);
+        lang = langid_identify_with_logprob(lid, text, textlen, &logprob);
+        docs++;
+        bytes += textlen;
+        if (p_flag) printf("%s,%zd,%.17g\n", lang, textlen, logprob);
+        else printf("%s,%zd\n", lang, textlen);
       }
 
     }
@@ -112,11 +262,15 @@ int main(int argc, char **argv){
          * presumably. Anything that returns data should be fair game.*/
         if ((fd = open(path, O_RDONLY))==-1) {
           lang = no_file;
+          textlen = 0;
+          logprob = NAN;
         }
         else {
           textlen = lseek(fd, 0, SEEK_END);
           text = (char *) mmap(NULL, textlen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-          lang = identify(lid, text, textlen);
+          lang = langid_identify_with_logprob(lid, text, textlen, &logprob);
+          docs++;
+          bytes += textlen;
 
           /* no need to munmap if textlen is 0 */
           if (textlen && (munmap(text, textlen) == -1)) {
@@ -126,21 +280,53 @@ int main(int argc, char **argv){
 
           close(fd);
         }
-        printf("%s,%zd,%s\n", path, textlen, lang);
+        if (p_flag) printf("%s,%zd,%s,%.17g\n", path, textlen, lang, logprob);
+        else printf("%s,%zd,%s\n", path, textlen, lang);
       }
 
+    }
+    else if (s_flag) { /*segment mode*/
+
+      /* read all of stdin and label each span of a single language */
+      textlen = getdelim(&text, &text_size, EOF, stdin);
+      if ((err = langid_identify_spans(lid, text, textlen, window, &spans, &num_spans)) != LANGID_OK) {
+        fprintf(stderr, "unable to segment input: %s\n", langid_strerror(err));
+        exit(-1);
+      }
+      if (textlen > 0) {
+        docs++;
+        bytes += textlen;
+      }
+      for (i=0; i < num_spans; i++){
+        printf("%s,%d,%d\n", spans[i].lang, spans[i].start, spans[i].len);
+      }
+      free(spans);
+      free(text);
+
     }
     else { /*file mode*/
 
       /* read all of stdin and process as a single file */
       textlen = getdelim(&text, &text_size, EOF, stdin);
-      lang = identify(lid, text, textlen);
-      printf("%s,%zd\n", lang, textlen);
+      lang = langid_identify_with_logprob(lid, text, textlen, &logprob);
+      docs++;
+      bytes += textlen;
+      if (p_flag) printf("%s,%zd,%.17g\n", lang, textlen, logprob);
+      else printf("%s,%zd\n", lang, textlen);
       free(text);
 
     }
 
+    if (cpu >= 0) {
+      elapsed = now() - start;
+      fprintf(stderr, "cpu %d (node %u): %lu documents, %lu bytes in %.3fs (%.2f MB/s)\n",
+          cpu, node, docs, bytes, elapsed, bytes / elapsed / 1e6);
+    }
+    if (langid_cache_stats(cache, &hits, &misses) == LANGID_OK)
+      fprintf(stderr, "cache: %lu hits, %lu misses\n", hits, misses);
+
     destroy_identifier(lid);
+    langid_cache_destroy(cache);
     return 0;
 }
 
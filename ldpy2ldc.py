@@ -7,19 +7,60 @@ Marco Lui, July 2014
 import argparse
 import langid.langid as langid
 import array
+import numpy
 import sys
 from itertools import islice
 
 model_template = """\
 #include "model.h"
 
-unsigned tk_nextmove[NUM_STATES][256] = {tk_nextmove};
-unsigned tk_output_c[NUM_STATES] = {tk_output_c};
-unsigned tk_output_s[NUM_STATES] = {tk_output_s};
-unsigned tk_output[] = {tk_output};
-double nb_pc[NUM_LANGS] = {nb_pc};
-double nb_ptc[{nb_ptc_size}] = {nb_ptc};
-char *nb_classes[NUM_LANGS] = {nb_classes};
+/* The model tables are linked in directly from {blob}. Symbols take the
+ * target's user label prefix and .type/.size are only emitted for ELF, so
+ * this assembles for both ELF and Mach-O targets.
+ */
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#define SYM(name) STR(__USER_LABEL_PREFIX__) #name
+
+#ifdef __APPLE__
+#define RODATA "__TEXT,__const"
+#else
+#define RODATA ".rodata"
+#endif
+
+#ifdef __ELF__
+#define OBJECT(name, size) ".type " SYM(name) ", %object\\n" ".size " SYM(name) ", " #size "\\n"
+#else
+#define OBJECT(name, size)
+#endif
+
+__asm__(
+  ".pushsection " RODATA "\\n"
+{incbin}
+  ".popsection\\n"
+);
+
+const char *const langid_nb_classes[NUM_LANGS] = {nb_classes};
+"""
+
+incbin_template = """\
+  ".balign {align}\\n"
+  ".globl " SYM({name}) "\\n"
+  OBJECT({name}, {size})
+  SYM({name}) ":\\n"
+  ".incbin \\"{blob}\\", {offset}, {size}\\n"
+"""
+
+c_arrays_template = """\
+#include "model.h"
+
+const unsigned langid_tk_nextmove[NUM_STATES][256] = {tk_nextmove};
+const unsigned langid_tk_output_c[NUM_STATES] = {tk_output_c};
+const unsigned langid_tk_output_s[NUM_STATES] = {tk_output_s};
+const unsigned langid_tk_output[] = {tk_output};
+const double langid_nb_pc[NUM_LANGS] = {nb_pc};
+const double langid_nb_ptc[{nb_ptc_size}] = {nb_ptc};
+const char *const langid_nb_classes[NUM_LANGS] = {nb_classes};
 """
 
 header_template = """\
@@ -30,22 +71,25 @@ header_template = """\
 #define NUM_LANGS {num_langs}
 #define NUM_STATES {num_states}
 
-extern unsigned tk_nextmove[NUM_STATES][256];
-extern unsigned tk_output_c[NUM_STATES];
-extern unsigned tk_output_s[NUM_STATES];
-extern unsigned tk_output[];
-extern double nb_pc[NUM_LANGS];
-extern double nb_ptc[{nb_ptc_size}];
-extern char *nb_classes[NUM_LANGS];
+extern const unsigned langid_tk_nextmove[NUM_STATES][256];
+extern const unsigned langid_tk_output_c[NUM_STATES];
+extern const unsigned langid_tk_output_s[NUM_STATES];
+extern const unsigned langid_tk_output[];
+extern const double langid_nb_pc[NUM_LANGS];
+extern const double langid_nb_ptc[{nb_ptc_size}];
+extern const char *const langid_nb_classes[NUM_LANGS];
 
 #endif
 """
 
+# alignment of each table within the binary blob, in bytes
+BLOB_ALIGN = 64
+
 def pack_tk_output(ident):
   num_states = len(ident.tk_nextmove) >> 8
 
   # tk_output is a mapping from state to list of feats completed by entering that state.
-  # we encode it as a single array of 2-byte values. each "entry" is a state label, 
+  # we encode it as a single array of 2-byte values. each "entry" is a state label,
   # a number representing a count followed by count featlabels
   tk_output_c = []
   tk_output_s = []
@@ -76,17 +120,109 @@ def chunk(seq, chunksize):
     if not chunk: break
     yield chunk
 
+def as_numpy(seq):
+  """
+  View an array.array without copying, otherwise convert via numpy
+  """
+  if isinstance(seq, array.array):
+    return numpy.frombuffer(seq, dtype=numpy.dtype(seq.typecode))
+  return numpy.asarray(seq)
+
+def write_blob(f, tables):
+  """
+  Write (name, ndarray) pairs to f back to back, each aligned to BLOB_ALIGN
+  bytes in the native layout of the target. Returns (name, offset, size)
+  for each table.
+  """
+  layout = []
+  offset = 0
+  for name, data in tables:
+    pad = -offset % BLOB_ALIGN
+    f.write(b'\0' * pad)
+    offset += pad
+    f.write(data.tobytes())
+    layout.append((name, offset, data.nbytes))
+    offset += data.nbytes
+  return layout
+
+def encode_varint(n):
+  """
+  Encode a single non-negative integer as a protocol buffer varint
+  """
+  out = bytearray()
+  while n > 0x7f:
+    out.append((n & 0x7f) | 0x80)
+    n >>= 7
+  out.append(n)
+  return bytes(out)
+
+def encode_varints(seq):
+  """
+  Encode a sequence of non-negative integers as consecutive protocol buffer
+  varints. This is vectorized over the sequence, making one pass for each
+  byte of the longest encoding rather than one per value.
+  """
+  v = as_numpy(seq).astype(numpy.uint64)
+  if len(v) == 0:
+    return b''
+
+  nbytes = numpy.ones(len(v), dtype=numpy.intp)
+  for shift in range(7, 64, 7):
+    nbytes += (v >> numpy.uint64(shift)) > 0
+
+  ends = numpy.cumsum(nbytes)
+  starts = ends - nbytes
+  out = numpy.empty(ends[-1], dtype=numpy.uint8)
+  for i in range(nbytes.max()):
+    mask = nbytes > i
+    byte = (v[mask] >> numpy.uint64(7 * i)) & numpy.uint64(0x7f)
+    more = (nbytes[mask] > i + 1).astype(numpy.uint64) << numpy.uint64(7)
+    out[starts[mask] + i] = byte | more
+  return out.tobytes()
+
+def write_pb_varint(f, field, value):
+  f.write(encode_varint(field << 3 | 0))
+  f.write(encode_varint(value))
+
+def write_pb_bytes(f, field, payload):
+  f.write(encode_varint(field << 3 | 2))
+  f.write(encode_varint(len(payload)))
+  f.write(payload)
+
+def write_protobuf(f, num_feats, num_langs, num_states, tk_nextmove, tk_output_c, tk_output_s, tk_output, nb_pc, nb_ptc, nb_classes):
+  """
+  Stream a LanguageIdentifier message (see langid.proto) to f. The message
+  is encoded by hand so that the large packed fields can be produced from
+  numpy buffers, instead of going through python lists in langid_pb2.
+  """
+  write_pb_varint(f, 1, num_feats)
+  write_pb_varint(f, 2, num_langs)
+  write_pb_varint(f, 3, num_states)
+
+  write_pb_bytes(f, 4, encode_varints(tk_nextmove))
+  write_pb_bytes(f, 5, encode_varints(tk_output_c))
+  write_pb_bytes(f, 6, encode_varints(tk_output_s))
+  write_pb_bytes(f, 7, encode_varints(tk_output))
+
+  write_pb_bytes(f, 8, numpy.ascontiguousarray(nb_pc, dtype='<f8').tobytes())
+  write_pb_bytes(f, 9, numpy.ascontiguousarray(nb_ptc, dtype='<f8').tobytes())
+
+  for c in nb_classes:
+    write_pb_bytes(f, 10, '{}'.format(c).encode('utf8'))
+
 
 if __name__ == "__main__":
   parser = argparse.ArgumentParser()
-  parser.add_argument("--output", "-o", default=sys.stdout, help="write exported model to", type=argparse.FileType('w'))
+  parser.add_argument("--output", "-o", default=sys.stdout, help="write exported model to", type=argparse.FileType('wb'))
   parser.add_argument("--header", action="store_true", help="produce header file")
   parser.add_argument("--protobuf", action="store_true", help="produce model in protocol buffer format")
+  parser.add_argument("--blob", default="model.bin", help="write model tables for the C source to this file, which it links in with .incbin")
+  parser.add_argument("--c-arrays", action="store_true", help="produce C source with the model tables as array initializers instead of a blob")
   parser.add_argument("model", help="read model from")
   args = parser.parse_args()
 
-  if args.protobuf and args.header:
-    parser.error("can only specify one of --protobuf or --header")
+  if sum((args.protobuf, args.header, args.c_arrays)) > 1:
+    parser.error("can only specify one of --protobuf, --header or --c-arrays")
 
   ident = langid.LanguageIdentifier.from_modelpath(args.model)
 
@@ -103,35 +239,15 @@ if __name__ == "__main__":
   nb_ptc_size = num_feats * num_langs
 
   if args.protobuf:
-    import langid_pb2
-
     tk_output_c, tk_output_s, tk_output = pack_tk_output(ident)
 
-    lid = langid_pb2.LanguageIdentifier()
+    write_protobuf(args.output, num_feats, num_langs, num_states,
+        ident.tk_nextmove, tk_output_c, tk_output_s, tk_output,
+        ident.nb_pc, ident.nb_ptc, ident.nb_classes)
 
-    # basic parameters
-    lid.num_feats = num_feats
-    lid.num_langs = num_langs
-    lid.num_states = num_states
-
-    # pack the tokenizer
-    lid.tk_nextmove.extend(ident.tk_nextmove)
-    lid.tk_output_c.extend(tk_output_c)
-    lid.tk_output_s.extend(tk_output_s)
-    lid.tk_output.extend(tk_output)
-
-    # pack the classifier parameters
-    lid.nb_pc.extend(ident.nb_pc.tolist())
-    lid.nb_ptc.extend(ident.nb_ptc.ravel().tolist())
-
-    # pack the class labels
-    lid.nb_classes.extend('{}'.format(c) for c in ident.nb_classes)
-
-    args.output.write(lid.SerializeToString())
-    
   elif args.header:
     args.output.write(header_template.format(**locals()))
-  else:
+  elif args.c_arrays:
     # chunk tk_nextmove back into length-256 array initializers, to avoid C warnings
     # about initialization mismatches
     tk_nextmove = as_c_array_init( as_c_array_init(c) for c in chunk(ident.tk_nextmove,256))
@@ -140,9 +256,29 @@ if __name__ == "__main__":
     tk_output_c = as_c_array_init(tk_output_c)
     tk_output_s = as_c_array_init(tk_output_s)
     tk_output = as_c_array_init(tk_output)
-        
+
     nb_pc =  as_c_array_init(ident.nb_pc)
     nb_ptc = as_c_array_init(ident.nb_ptc.ravel())
     nb_classes = as_c_array_init('"{}"'.format(c) for c in ident.nb_classes)
 
+    args.output.write(c_arrays_template.format(**locals()))
+  else:
+    # the tables are written in the host's byte order and the native types
+    # of the declarations in model.h (unsigned and double)
+    tk_output_c, tk_output_s, tk_output = pack_tk_output(ident)
+    tables = [
+      ("langid_tk_nextmove", as_numpy(ident.tk_nextmove).astype(numpy.uintc)),
+      ("langid_tk_output_c", numpy.array(tk_output_c, dtype=numpy.uintc)),
+      ("langid_tk_output_s", numpy.array(tk_output_s, dtype=numpy.uintc)),
+      ("langid_tk_output", numpy.array(tk_output, dtype=numpy.uintc)),
+      ("langid_nb_pc", numpy.ascontiguousarray(ident.nb_pc, dtype=numpy.double)),
+      ("langid_nb_ptc", numpy.ascontiguousarray(ident.nb_ptc, dtype=numpy.double).ravel()),
+    ]
+    with open(args.blob, 'wb') as f:
+      layout = write_blob(f, tables)
+
+    blob = args.blob
+    incbin = "".join(incbin_template.format(name=name, offset=offset, size=size, blob=blob, align=BLOB_ALIGN) for name, offset, size in layout)
+    nb_classes = as_c_array_init('"{}"'.format(c) for c in ident.nb_classes)
+
     args.output.write(model_template.format(**locals()))
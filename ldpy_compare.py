@@ -0,0 +1,250 @@
+"""
+Compare langid.c against langid.py over a corpus of documents.
+
+Each document must receive the same label from both, with log-probabilities
+that agree within a relative tolerance, and the throughput of langid.c is
+reported (and optionally recorded per build variant). The exit status is
+non-zero if labels drift, scores drift or throughput regresses, so the script
+can gate builds that change the tokenizer or the scoring.
+
+The documents are given as a list of paths on stdin, as for batch mode.
+With --segment, segment mode is checked instead: given a window covering
+a whole document, it must label the document as one span with langid.py's
+label.
+
+langid.py outputs can be computed once with --save-reference and reused
+with --reference, so langid.py is only needed when the model or corpus
+changes.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+def read_reference(path):
+  ref = {}
+  with open(path) as f:
+    for line in f:
+      doc, lang, logprob = line.rstrip('\n').split('\t')
+      ref[doc] = (lang, float(logprob))
+  return ref
+
+def write_reference(path, ref):
+  with open(path, 'w') as f:
+    for doc in sorted(ref):
+      lang, logprob = ref[doc]
+      f.write('{0}\t{1}\t{2!r}\n'.format(doc, lang, logprob))
+
+def compute_reference(model, docs):
+  import langid.langid as langid
+  ident = langid.LanguageIdentifier.from_modelpath(model, norm_probs=False)
+  ref = {}
+  for doc in docs:
+    with open(doc, 'rb') as f:
+      lang, logprob = ident.classify(f.read())
+    ref[doc] = (lang, float(logprob))
+  return ref
+
+def run_langid(binary, extra_args, docs):
+  """
+  Run langid.c in batch mode over docs, returning its output per document
+  and the total bytes processed.
+  """
+  proc = subprocess.Popen([binary, '-b', '-p'] + extra_args, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+  out, _ = proc.communicate(''.join(d + '\n' for d in docs).encode('utf8'))
+  if proc.returncode != 0:
+    sys.exit("{0} exited with status {1}".format(binary, proc.returncode))
+
+  result = {}
+  total = 0
+  for line in out.decode('utf8').splitlines():
+    doc, length, lang, logprob = line.rsplit(',', 3)
+    result[doc] = (lang, float(logprob))
+    total += int(length)
+  return result, total
+
+def run_segments(binary, extra_args, docs):
+  """
+  Run langid.c in segment mode over each of docs with a window covering the
+  whole document, which must then be labelled as a single span. Returns the
+  label per document (or the spans, if there are several) and the total
+  bytes processed.
+  """
+  result = {}
+  total = 0
+  for doc in docs:
+    size = os.path.getsize(doc)
+    with open(doc, 'rb') as f:
+      proc = subprocess.Popen([binary, '-s', '-w', str(size + 1)] + extra_args, stdin=f, stdout=subprocess.PIPE)
+      out, _ = proc.communicate()
+    if proc.returncode != 0:
+      sys.exit("{0} exited with status {1}".format(binary, proc.returncode))
+    spans = out.decode('utf8').splitlines()
+    lang, start, length = spans[0].split(',') if len(spans) == 1 else (None, None, None)
+    if lang is not None and start == '0' and int(length) == size:
+      result[doc] = (lang, None)
+    else:
+      result[doc] = (' '.join(spans), None)
+    total += size
+  return result, total
+
+def median(values):
+  values = sorted(values)
+  mid = len(values) // 2
+  return values[mid] if len(values) % 2 else (values[mid - 1] + values[mid]) / 2.0
+
+def benchmark(binary, extra_args, docs, min_bytes, runs):
+  """
+  Measure the throughput of langid.c in MB/s. The document list is repeated
+  until it covers at least min_bytes, so that a single process spends its
+  time identifying rather than starting up, and the median of runs such
+  processes is taken. Returns the throughput and the bytes per run.
+  """
+  size = sum(os.path.getsize(d) for d in docs)
+  if size == 0:
+    return float('inf'), 0
+  passes = max(1, -(-min_bytes // size))
+  stdin = ''.join(d + '\n' for d in docs * passes).encode('utf8')
+
+  rates = []
+  for _ in range(runs):
+    with open(os.devnull, 'wb') as devnull:
+      proc = subprocess.Popen([binary, '-b'] + extra_args, stdin=subprocess.PIPE, stdout=devnull)
+      start = time.time()
+      proc.communicate(stdin)
+      elapsed = time.time() - start
+    if proc.returncode != 0:
+      sys.exit("{0} exited with status {1}".format(binary, proc.returncode))
+    rates.append(size * passes / elapsed / 1e6 if elapsed > 0 else float('inf'))
+  return median(rates), size * passes
+
+def read_baseline(path):
+  baseline = {}
+  try:
+    with open(path) as f:
+      for line in f:
+        variant, throughput = line.rstrip('\n').split('\t')
+        baseline[variant] = float(throughput)
+  except IOError:
+    pass
+  return baseline
+
+def write_baseline(path, baseline):
+  with open(path, 'w') as f:
+    for variant in sorted(baseline):
+      f.write('{0}\t{1:.2f}\n'.format(variant, baseline[variant]))
+
+def recorded_throughput(record, variant):
+  """
+  Median throughput of earlier runs of variant logged to record, or None
+  """
+  rates = []
+  try:
+    with open(record) as f:
+      for line in f:
+        fields = line.rstrip('\n').split('\t')
+        if fields[0] == variant:
+          rates.append(float(fields[3]))
+  except IOError:
+    pass
+  return median(rates) if rates else None
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--langid", default="./langid", help="langid.c binary to test")
+  parser.add_argument("--args", default="", help="extra arguments for the langid.c binary, e.g. '-m x.pmodel'")
+  parser.add_argument("--model", default="ldpy.model", help="langid.py model to compute reference outputs with")
+  parser.add_argument("--reference", help="read precomputed langid.py outputs from")
+  parser.add_argument("--save-reference", help="compute langid.py outputs and write them to")
+  parser.add_argument("--segment", action="store_true", help="check segment mode, which must label each document as one span, instead of batch mode")
+  parser.add_argument("--tolerance", type=float, default=1e-9, help="maximum relative difference in log-probability")
+  parser.add_argument("--max-disagree", type=int, default=0, help="number of label disagreements allowed")
+  parser.add_argument("--record", help="append throughput for this run to")
+  parser.add_argument("--baseline", help="read the expected throughput of each build variant from")
+  parser.add_argument("--save-baseline", action="store_true", help="store the measured throughput for the variant in --baseline")
+  parser.add_argument("--variant", default="default", help="name of the build variant for --record and --baseline")
+  parser.add_argument("--max-slowdown", type=float, help="fail if throughput is this fraction below the baseline for the variant, or else the median recorded for it")
+  parser.add_argument("--bench-bytes", type=int, default=8000000, help="bytes of text each timed run of langid.c identifies")
+  parser.add_argument("--bench-runs", type=int, default=5, help="take the median throughput of this many timed runs")
+  args = parser.parse_args()
+
+  docs = [l.rstrip('\n') for l in sys.stdin if l.strip()]
+
+  missing = []
+  if args.reference:
+    ref = read_reference(args.reference)
+    if docs:
+      missing = [d for d in docs if d not in ref]
+      docs = [d for d in docs if d in ref]
+    else:
+      docs = sorted(ref)
+  else:
+    ref = compute_reference(args.model, docs)
+    if args.save_reference:
+      write_reference(args.save_reference, ref)
+
+  if args.segment:
+    result, total = run_segments(args.langid, args.args.split(), docs)
+  else:
+    result, total = run_langid(args.langid, args.args.split(), docs)
+
+  disagree = []
+  max_diff = 0.0
+  for doc in docs:
+    ref_lang, ref_lp = ref[doc]
+    lang, lp = result.get(doc, (None, float('nan')))
+    if lang != ref_lang:
+      disagree.append((doc, ref_lang, lang))
+    elif lp is not None:
+      diff = abs(lp - ref_lp) / max(1.0, abs(ref_lp))
+      if not diff <= max_diff:
+        max_diff = diff
+
+  print("documents: {0}".format(len(docs)))
+  if missing:
+    print("not in reference: {0}".format(len(missing)))
+    for doc in missing[:10]:
+      print("  {0}".format(doc))
+  print("label agreement: {0}/{1}".format(len(docs) - len(disagree), len(docs)))
+  for doc, ref_lang, lang in disagree[:10]:
+    print("  {0}: langid.py={1} langid.c={2}".format(doc, ref_lang, lang))
+  print("max relative logprob difference: {0:.3g}".format(max_diff))
+
+  failed = False
+  if missing:
+    print("FAIL: {0} documents have no reference output; regenerate it with --save-reference".format(len(missing)))
+    failed = True
+  if len(disagree) > args.max_disagree:
+    print("FAIL: {0} label disagreements".format(len(disagree)))
+    failed = True
+  if not max_diff <= args.tolerance:
+    print("FAIL: logprob difference exceeds {0:g}".format(args.tolerance))
+    failed = True
+
+  if args.max_slowdown is not None or args.record or args.save_baseline:
+    throughput, bench_bytes = benchmark(args.langid, args.args.split(), docs, args.bench_bytes, args.bench_runs)
+    print("throughput: {0:.2f} MB/s (median of {1} runs over {2} bytes)".format(throughput, args.bench_runs, bench_bytes))
+
+    baseline = read_baseline(args.baseline) if args.baseline else {}
+    if args.variant in baseline:
+      expected, source = baseline[args.variant], "baseline"
+    elif args.record:
+      expected, source = recorded_throughput(args.record, args.variant), "median recorded"
+    else:
+      expected = None
+    if args.max_slowdown is not None and expected is not None and throughput < expected * (1 - args.max_slowdown):
+      print("FAIL: throughput {0:.2f} MB/s is more than {1:g} below {2} {3:.2f} MB/s".format(throughput, args.max_slowdown, source, expected))
+      failed = True
+
+    if args.save_baseline:
+      if not args.baseline:
+        parser.error("--save-baseline needs --baseline")
+      baseline[args.variant] = throughput
+      write_baseline(args.baseline, baseline)
+    if args.record:
+      with open(args.record, 'a') as f:
+        f.write('{0}\t{1}\t{2}\t{3:.4f}\t{4}\n'.format(args.variant, len(docs), bench_bytes, throughput, len(docs) - len(disagree)))
+
+  sys.exit(1 if failed else 0)
@@ -13,82 +13,179 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include "langid.pb-c.h"
-#include "liblangid.h"
-#include "sparseset.h"
+#include "liblangid_internal.h"
 #include "model.h"
 
-/* Return a pointer to a LanguageIdentifier based on the in-built default model
+int langid_version(void) {
+    return (LANGID_VERSION_MAJOR << 16) | LANGID_VERSION_MINOR;
+}
+
+unsigned langid_capabilities(void) {
+    return LANGID_CAP_BUILTIN_MODEL | LANGID_CAP_LOAD_MODEL | LANGID_CAP_CACHE | LANGID_CAP_SPANS | LANGID_CAP_REPLICATE;
+}
+
+const char *langid_strerror(int err) {
+    switch (err) {
+        case LANGID_OK: return "success";
+        case LANGID_ENOMEM: return "out of memory";
+        case LANGID_EOPEN: return "unable to read model file";
+        case LANGID_EMODEL: return "malformed model";
+        case LANGID_EINVAL: return "invalid argument";
+        default: return "unknown error";
+    }
+}
+
+/* Allocate an empty LanguageIdentifier with sparsesets of the given sizes,
+ * returning NULL if out of memory.
  */
-LanguageIdentifier *get_default_identifier(void) {
+static LanguageIdentifier *alloc_identifier(unsigned num_states, unsigned num_feats) {
     LanguageIdentifier *lid;
 
-    if ((lid = (LanguageIdentifier *) malloc(sizeof(LanguageIdentifier))) == 0) exit(-1);
+    if ((lid = (LanguageIdentifier *) calloc(1, sizeof(LanguageIdentifier))) == 0) return NULL;
 
-    lid->sv = alloc_set(NUM_STATES);
-    lid->fv = alloc_set(NUM_FEATS);
+    if ((lid->sv = langid_set_alloc(num_states)) == 0 || (lid->fv = langid_set_alloc(num_feats)) == 0) {
+        destroy_identifier(lid);
+        return NULL;
+    }
+    lid->direct_threshold = DIRECT_THRESHOLD;
+
+    return lid;
+}
+
+/* Return a pointer to a LanguageIdentifier based on the in-built default model,
+ * or NULL if out of memory.
+ */
+LanguageIdentifier *get_default_identifier(void) {
+    LanguageIdentifier *lid;
+
+    if ((lid = alloc_identifier(NUM_STATES, NUM_FEATS)) == 0) return NULL;
 
     lid->num_feats = NUM_FEATS;
     lid->num_langs = NUM_LANGS;
     lid->num_states = NUM_STATES;
-    lid->tk_nextmove = &tk_nextmove;
-    lid->tk_output_c = &tk_output_c;
-    lid->tk_output_s = &tk_output_s;
-    lid->tk_output = &tk_output;
-    lid->nb_pc = &nb_pc;
-    lid->nb_ptc = &nb_ptc;
-    lid->nb_classes = &nb_classes;
+    lid->tk_nextmove = &langid_tk_nextmove;
+    lid->tk_output_c = &langid_tk_output_c;
+    lid->tk_output_s = &langid_tk_output_s;
+    lid->tk_output = &langid_tk_output;
+    lid->nb_pc = &langid_nb_pc;
+    lid->nb_ptc = &langid_nb_ptc;
+    lid->nb_classes = &langid_nb_classes;
 
-    lid->protobuf_model = NULL;
+    lid->builtin_model = 1;
 
     return lid;
 }
 
-LanguageIdentifier *load_identifier(char *model_path) {
+/* Check that the tables of an unpacked model are consistent with its stated
+ * dimensions, so that a corrupt model cannot cause out-of-bounds accesses.
+ */
+static int validate_model(Langid__LanguageIdentifier *msg) {
+    size_t i;
+
+    if (msg->num_feats <= 0 || msg->num_langs <= 0 || msg->num_states <= 0) return 0;
+    if (msg->n_tk_nextmove != (size_t) msg->num_states * 256) return 0;
+    if (msg->n_tk_output_c != msg->num_states || msg->n_tk_output_s != msg->num_states) return 0;
+    if (msg->n_nb_pc != msg->num_langs || msg->n_nb_classes != msg->num_langs) return 0;
+    if (msg->n_nb_ptc != (size_t) msg->num_feats * msg->num_langs) return 0;
+
+    for (i=0; i < msg->n_tk_nextmove; i++){
+        if (msg->tk_nextmove[i] < 0 || msg->tk_nextmove[i] >= msg->num_states) return 0;
+    }
+    for (i=0; i < msg->num_states; i++){
+        if (msg->tk_output_c[i] < 0 || msg->tk_output_s[i] < 0) return 0;
+        if ((size_t) msg->tk_output_s[i] + msg->tk_output_c[i] > msg->n_tk_output) return 0;
+    }
+    for (i=0; i < msg->n_tk_output; i++){
+        if (msg->tk_output[i] < 0 || msg->tk_output[i] >= msg->num_feats) return 0;
+    }
+
+    return 1;
+}
+
+/* Hash the tables of a loaded model, so that cache entries made with it are
+ * distinct from those of any other model.
+ */
+static uint64_t model_fingerprint(const LanguageIdentifier *lid){
+    uint64_t h;
+    h = langid_hash_bytes((const char *) *lid->tk_nextmove, (size_t) lid->num_states * 256 * sizeof(unsigned), 0);
+    h = langid_hash_bytes((const char *) *lid->nb_pc, (size_t) lid->num_langs * sizeof(double), h);
+    h = langid_hash_bytes((const char *) *lid->nb_ptc, (size_t) lid->num_feats * lid->num_langs * sizeof(double), h);
+    return h;
+}
+
+/* Return a pointer to a LanguageIdentifier based on the model stored at
+ * model_path, or NULL on failure.
+ */
+LanguageIdentifier *load_identifier(const char *model_path) {
+    return langid_load_identifier(model_path, NULL);
+}
+
+/* As load_identifier(), storing LANGID_OK or the reason for failure in err
+ * if it is not NULL.
+ */
+LanguageIdentifier *langid_load_identifier(const char *model_path, int *err) {
 		Langid__LanguageIdentifier *msg;
-		int fd, model_len;
+		int fd;
+		off_t model_len;
 		unsigned char *model_buf;
     LanguageIdentifier *lid;
+    int dummy;
 #ifdef DEBUG
 		int i;
 #endif
 
+    if (err == NULL) err = &dummy;
+
 #ifdef DEBUG
 		fprintf(stderr, "loading a model from: %s\n", model_path);
 #endif
 
 		/* Use mmap to access the model file */
 		if ((fd = open(model_path, O_RDONLY))==-1) {
-			fprintf(stderr, "unable to open: %s\n", model_path);
-			exit(-1);
+			*err = LANGID_EOPEN;
+			return NULL;
 		}
 		model_len = lseek(fd, 0, SEEK_END);
-		model_buf = (unsigned char *) mmap(NULL, model_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (model_len <= 0) {
+			close(fd);
+			*err = (model_len == 0) ? LANGID_EMODEL : LANGID_EOPEN;
+			return NULL;
+		}
+		model_buf = (unsigned char *) mmap(NULL, model_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (model_buf == MAP_FAILED) {
+			*err = LANGID_EOPEN;
+			return NULL;
+		}
 
-		/*printf("read in a model of size %d\n", model_len);*/
+		/* unpacking copies everything out of the buffer, so it can be released */
 		msg = langid__language_identifier__unpack(NULL, model_len, model_buf);
+		munmap(model_buf, model_len);
 
-		if (msg == NULL) {
-			fprintf(stderr, "error unpacking model from: %s\n", model_path);
-			exit(-1);
+		if (msg == NULL || !validate_model(msg)) {
+			if (msg != NULL) langid__language_identifier__free_unpacked(msg, NULL);
+			*err = LANGID_EMODEL;
+			return NULL;
 		}
 
-    if ((lid = (LanguageIdentifier *) malloc(sizeof(LanguageIdentifier))) == 0) exit(-1);
-
-    lid->sv = alloc_set(msg->num_states);
-    lid->fv = alloc_set(msg->num_feats);
+    if ((lid = alloc_identifier(msg->num_states, msg->num_feats)) == 0) {
+        langid__language_identifier__free_unpacked(msg, NULL);
+        *err = LANGID_ENOMEM;
+        return NULL;
+    }
 
     lid->num_feats = msg->num_feats;
     lid->num_langs = msg->num_langs;
     lid->num_states = msg->num_states;
 
-    lid->tk_nextmove = (unsigned (*)[][256])msg->tk_nextmove;
-    lid->tk_output_c = (unsigned (*)[])msg->tk_output_c;
-    lid->tk_output_s = (unsigned (*)[])msg->tk_output_s;
-    lid->tk_output = (unsigned (*)[])msg->tk_output;
+    lid->tk_nextmove = (const unsigned (*)[][256])msg->tk_nextmove;
+    lid->tk_output_c = (const unsigned (*)[])msg->tk_output_c;
+    lid->tk_output_s = (const unsigned (*)[])msg->tk_output_s;
+    lid->tk_output = (const unsigned (*)[])msg->tk_output;
 
-    lid->nb_pc = (double (*)[]) msg->nb_pc;
-    lid->nb_ptc =(double (*)[]) msg->nb_ptc;
-    lid->nb_classes = (char *(*)[]) msg->nb_classes;
+    lid->nb_pc = (const double (*)[]) msg->nb_pc;
+    lid->nb_ptc =(const double (*)[]) msg->nb_ptc;
+    lid->nb_classes = (const char *const (*)[]) msg->nb_classes;
 
 #ifdef DEBUG
 		fprintf(stderr, "num_feats: %d num_langs: %d num_states: %d\n", lid->num_feats, lid->num_langs, lid->num_states);
@@ -102,48 +199,198 @@ LanguageIdentifier *load_identifier(char *model_path) {
 		}
 #endif
 
+    lid->builtin_model = 0;
     lid->protobuf_model = msg;
+    lid->model_id = model_fingerprint(lid);
 
+    *err = LANGID_OK;
     return lid;
 }
 
+/* Round a size up to a multiple of the cache line size */
+#define ALIGN_UP(n) (((n) + 63) & ~(size_t) 63)
+
+/* Return a new LanguageIdentifier using private copies of the model tables of
+ * lid, or NULL on failure with the reason in err if it is not NULL.
+ *
+ * The copies are written by the calling thread, so under the default
+ * first-touch policy they are placed on that thread's NUMA node. A thread
+ * pinned to a node can replicate a shared identifier to avoid remote memory
+ * accesses during identification. The replica does not depend on lid, and
+ * does not inherit its cache.
+ */
+LanguageIdentifier *langid_replicate_identifier(const LanguageIdentifier *lid, int *err) {
+    LanguageIdentifier *rep;
+    size_t nextmove_size, states_size, output_size, pc_size, ptc_size, classes_size, names_size, len;
+    unsigned i, num_output = 0;
+    char *buf, *names;
+    const char **classes;
+    int dummy;
+
+    if (err == NULL) err = &dummy;
+
+    /* the length of tk_output is not stored, so recover it from the offsets */
+    for (i=0; i < lid->num_states; i++){
+        if ((*lid->tk_output_s)[i] + (*lid->tk_output_c)[i] > num_output)
+            num_output = (*lid->tk_output_s)[i] + (*lid->tk_output_c)[i];
+    }
+
+    names_size = 0;
+    for (i=0; i < lid->num_langs; i++){
+        names_size += strlen((*lid->nb_classes)[i]) + 1;
+    }
+
+    nextmove_size = ALIGN_UP((size_t) lid->num_states * 256 * sizeof(unsigned));
+    states_size = ALIGN_UP((size_t) lid->num_states * sizeof(unsigned));
+    output_size = ALIGN_UP((size_t) num_output * sizeof(unsigned));
+    pc_size = ALIGN_UP((size_t) lid->num_langs * sizeof(double));
+    ptc_size = ALIGN_UP((size_t) lid->num_feats * lid->num_langs * sizeof(double));
+    classes_size = ALIGN_UP((size_t) lid->num_langs * sizeof(char *));
+
+    if ((rep = alloc_identifier(lid->num_states, lid->num_feats)) == 0) {
+        *err = LANGID_ENOMEM;
+        return NULL;
+    }
+    if (posix_memalign((void **) &buf, 64, nextmove_size + 2 * states_size + output_size + pc_size + ptc_size + classes_size + names_size) != 0) {
+        destroy_identifier(rep);
+        *err = LANGID_ENOMEM;
+        return NULL;
+    }
+    rep->replica = buf;
+
+    rep->num_feats = lid->num_feats;
+    rep->num_langs = lid->num_langs;
+    rep->num_states = lid->num_states;
+
+    rep->tk_nextmove = memcpy(buf, *lid->tk_nextmove, (size_t) lid->num_states * 256 * sizeof(unsigned));
+    buf += nextmove_size;
+    rep->tk_output_c = memcpy(buf, *lid->tk_output_c, (size_t) lid->num_states * sizeof(unsigned));
+    buf += states_size;
+    rep->tk_output_s = memcpy(buf, *lid->tk_output_s, (size_t) lid->num_states * sizeof(unsigned));
+    buf += states_size;
+    rep->tk_output = memcpy(buf, *lid->tk_output, (size_t) num_output * sizeof(unsigned));
+    buf += output_size;
+    rep->nb_pc = memcpy(buf, *lid->nb_pc, (size_t) lid->num_langs * sizeof(double));
+    buf += pc_size;
+    rep->nb_ptc = memcpy(buf, *lid->nb_ptc, (size_t) lid->num_feats * lid->num_langs * sizeof(double));
+    buf += ptc_size;
+
+    classes = (const char **) buf;
+    names = buf + classes_size;
+    for (i=0; i < lid->num_langs; i++){
+        len = strlen((*lid->nb_classes)[i]) + 1;
+        classes[i] = memcpy(names, (*lid->nb_classes)[i], len);
+        names += len;
+    }
+    rep->nb_classes = (const char *const (*)[]) classes;
+
+    rep->builtin_model = lid->builtin_model;
+    rep->model_id = lid->model_id;
+    rep->direct_threshold = lid->direct_threshold;
+
+    *err = LANGID_OK;
+    return rep;
+}
+
 void destroy_identifier(LanguageIdentifier *lid){
+    if (lid == NULL) return;
     if (lid->protobuf_model != NULL) 
         langid__language_identifier__free_unpacked(lid->protobuf_model, NULL);
-    free_set(lid->sv);
-    free_set(lid->fv);
+    if (lid->replica != NULL)
+        free(lid->replica);
+    if (lid->sv != NULL) langid_set_free(lid->sv);
+    if (lid->fv != NULL) langid_set_free(lid->fv);
     free(lid);
 }
 
+int langid_num_langs(const LanguageIdentifier *lid){
+    return lid->num_langs;
+}
+
+/* Return the label of the i-th language of the model, or NULL if out of range */
+const char *langid_lang(const LanguageIdentifier *lid, int i){
+    if (i < 0 || i >= lid->num_langs) return NULL;
+    return (*lid->nb_classes)[i];
+}
+
+/* Return a cache for the results of up to size distinct inputs, or NULL on
+ * failure with the reason in err if it is not NULL.
+ */
+LangidResultCache *langid_cache_create(size_t size, int *err){
+    LangidResultCache *cache;
+    int dummy;
+
+    if (err == NULL) err = &dummy;
+    if (size == 0) {
+        *err = LANGID_EINVAL;
+        return NULL;
+    }
+    if ((cache = langid_cache_alloc(size)) == 0) {
+        *err = LANGID_ENOMEM;
+        return NULL;
+    }
+
+    *err = LANGID_OK;
+    return cache;
+}
+
+void langid_cache_destroy(LangidResultCache *cache){
+    if (cache != NULL) langid_cache_free(cache);
+}
+
+/* Look up and store results of lid in cache, so that repeated inputs are
+ * identified without tokenizing or scoring them again. NULL disables caching.
+ */
+int langid_enable_cache(LanguageIdentifier *lid, LangidResultCache *cache){
+    lid->cache = cache;
+    return LANGID_OK;
+}
+
+/* Set the length in bytes below which texts are scored directly rather than
+ * via the state and feature sets. 0 always uses the sets.
+ */
+int langid_set_direct_threshold(LanguageIdentifier *lid, int threshold){
+    if (threshold < 0) return LANGID_EINVAL;
+    lid->direct_threshold = threshold;
+    return LANGID_OK;
+}
+
+/* Report the hit and miss counts of a cache, over all identifiers using it */
+int langid_cache_stats(LangidResultCache *cache, unsigned long *hits, unsigned long *misses){
+    if (cache == NULL) return LANGID_EINVAL;
+    langid_cache_counts(cache, hits, misses);
+    return LANGID_OK;
+}
+
 /* 
  * Convert a text stream into a feature vector. The feature vector counts
  * how many times each sequence is seen.
  */
-void text_to_fv(LanguageIdentifier *lid, char *text, int textlen, Set *sv, Set *fv){
+static void text_to_fv(LanguageIdentifier *lid, char *text, int textlen, Set *sv, Set *fv){
   unsigned i, j, m, s=0;
   
-  clear(sv);
-  clear(fv);
+  langid_set_clear(sv);
+  langid_set_clear(fv);
 
   for (i=0; i < textlen; i++){
       s = (*lid->tk_nextmove)[s][(unsigned char) text[i]];
-      add(sv, s, 1);
+      langid_set_add(sv, s, 1);
   }
 
   /* convert the SV into the FV */
   for (i=0; i < sv->members; i++) {
   		m = sv->dense[i];
   		for (j=0; j<(*lid->tk_output_c)[m]; j++){
-				  add(fv, (*lid->tk_output)[(*lid->tk_output_s)[m]+j], sv->counts[i]);
+				  langid_set_add(fv, (*lid->tk_output)[(*lid->tk_output_s)[m]+j], sv->counts[i]);
 			}
 	}
 
   return;
 }
 
-void fv_to_logprob(LanguageIdentifier *lid, Set *fv, double logprob[]){
+static void fv_to_logprob(LanguageIdentifier *lid, Set *fv, double logprob[]){
     unsigned i, j, m;
-    double *nb_ptc_p;
+    const double *nb_ptc_p;
     /* Initialize using prior */
     for (i=0; i < lid->num_langs; i++){
         logprob[i] = (*lid->nb_pc)[i];
@@ -163,7 +410,53 @@ void fv_to_logprob(LanguageIdentifier *lid, Set *fv, double logprob[]){
     return;
 }
 
-int logprob_to_pred(LanguageIdentifier *lid, double logprob[]){
+/*
+ * Specializations of text_to_fv and fv_to_logprob for the in-built model or
+ * a replica of it. The model tables are loaded into locals once and the
+ * number of languages is a compile-time constant, so the scoring loop has a
+ * fixed trip count that the compiler is free to unroll and vectorize.
+ */
+static void text_to_fv_builtin(LanguageIdentifier *lid, char *text, int textlen, Set *sv, Set *fv){
+  const unsigned (*tk_nextmove)[256] = *lid->tk_nextmove;
+  const unsigned *tk_output_c = *lid->tk_output_c, *tk_output_s = *lid->tk_output_s, *tk_output = *lid->tk_output;
+  unsigned i, j, m, s=0;
+
+  langid_set_clear(sv);
+  langid_set_clear(fv);
+
+  for (i=0; i < textlen; i++){
+      s = tk_nextmove[s][(unsigned char) text[i]];
+      langid_set_add(sv, s, 1);
+  }
+
+  for (i=0; i < sv->members; i++) {
+      m = sv->dense[i];
+      for (j=0; j<tk_output_c[m]; j++){
+          langid_set_add(fv, tk_output[tk_output_s[m]+j], sv->counts[i]);
+      }
+  }
+}
+
+static void fv_to_logprob_builtin(LanguageIdentifier *lid, Set *fv, double logprob[NUM_LANGS]){
+    const double *nb_pc = *lid->nb_pc, *nb_ptc = *lid->nb_ptc;
+    unsigned i, j;
+    const double *nb_ptc_p;
+    double count;
+
+    for (j=0; j < NUM_LANGS; j++){
+        logprob[j] = nb_pc[j];
+    }
+
+    for (i=0; i < fv->members; i++){
+        nb_ptc_p = &nb_ptc[fv->dense[i] * NUM_LANGS];
+        count = fv->counts[i];
+        for (j=0; j < NUM_LANGS; j++){
+            logprob[j] += count * nb_ptc_p[j];
+        }
+    }
+}
+
+static int logprob_to_pred(LanguageIdentifier *lid, double logprob[]){
     int m=0, i;
 
     for (i=1; i<lid->num_langs; i++){
@@ -173,24 +466,200 @@ int logprob_to_pred(LanguageIdentifier *lid, double logprob[]){
     return m;
 }
 
-const char *identify(LanguageIdentifier *lid, char *text, int textlen){
+/*
+ * Add (sign=1) or remove (sign=-1) the contribution of the features completed
+ * on entering state s to a running vector of per-language scores.
+ */
+static void score_state(LanguageIdentifier *lid, unsigned s, double logprob[], double sign){
+    unsigned i, j, m;
+    const double *nb_ptc_p;
+
+    for (i=0; i<(*lid->tk_output_c)[s]; i++){
+        m = (*lid->tk_output)[(*lid->tk_output_s)[s]+i];
+        nb_ptc_p = &(*lid->nb_ptc)[m*lid->num_langs];
+        for (j=0; j < lid->num_langs; j++){
+            logprob[j] += sign * nb_ptc_p[j];
+        }
+    }
+}
+
+/*
+ * Score a text by adding each feature's contribution as soon as the DFA
+ * completes it, without building the state and feature sets. Features seen
+ * several times are added several times, so this only pays off for texts
+ * short enough that repeats are rare; see direct_threshold.
+ */
+static void text_to_logprob_direct(LanguageIdentifier *lid, char *text, int textlen, double logprob[]){
+    unsigned i, s=0;
+
+    for (i=0; i < lid->num_langs; i++){
+        logprob[i] = (*lid->nb_pc)[i];
+    }
+
+    for (i=0; i < textlen; i++){
+        s = (*lid->tk_nextmove)[s][(unsigned char) text[i]];
+        score_state(lid, s, logprob, 1.0);
+    }
+}
+
+/*
+ * Assign lang to bytes [from, to] of text, extending the last span if it has
+ * the same language and starting a new one otherwise. A new span never starts
+ * on a UTF-8 continuation byte; such bytes stay with the preceding span.
+ */
+static int label_bytes(char *text, int from, int to, const char *lang, LangidSpan **spans, int *n, int *cap){
+    LangidSpan *last = *n ? &(*spans)[*n-1] : NULL;
+    LangidSpan *grown;
+
+    if (last && last->lang != lang) {
+        while (from <= to && ((unsigned char) text[from] & 0xC0) == 0x80) {
+            last->len++;
+            from++;
+        }
+    }
+    if (from > to) return LANGID_OK;
+
+    if (last && last->lang == lang) {
+        last->len += to - from + 1;
+        return LANGID_OK;
+    }
+
+    if (*n == *cap) {
+        grown = (LangidSpan *) realloc(*spans, (*cap ? 2 * *cap : 16) * sizeof(LangidSpan));
+        if (grown == 0) return LANGID_ENOMEM;
+        *spans = grown;
+        *cap = *cap ? 2 * *cap : 16;
+    }
+    (*spans)[*n].start = from;
+    (*spans)[*n].len = to - from + 1;
+    (*spans)[*n].lang = lang;
+    (*n)++;
+    return LANGID_OK;
+}
+
+/*
+ * Segment a text into spans of a single language. A window of window bytes is
+ * slid over the DFA state stream, and the per-language scores are maintained
+ * incrementally: features completed by the byte entering the window are added
+ * and those completed by the byte leaving it are subtracted. Each byte takes the
+ * label of the window centred on it, and runs of equal labels form the spans.
+ *
+ * On success, spans is set to a malloc'ed array which the caller must free
+ * and num_spans to its length.
+ */
+int langid_identify_spans(LanguageIdentifier *lid, char *text, int textlen, int window, LangidSpan **spans, int *num_spans){
     double lp[lid->num_langs];
+    unsigned *ring, s=0;
+    int i, n=0, cap=0, labelled=0, centre, err = LANGID_OK;
+    const char *lang;
+
+    *spans = NULL;
+    *num_spans = 0;
+    if (window < 1) return LANGID_EINVAL;
+    if (textlen <= 0) return LANGID_OK;
+    if (window > textlen) window = textlen;
+
+    /* states of the last window bytes, needed to remove their features */
+    if ((ring = (unsigned *) malloc(window * sizeof(unsigned))) == 0) return LANGID_ENOMEM;
+
+    for (i=0; i < lid->num_langs; i++){
+        lp[i] = (*lid->nb_pc)[i];
+    }
+
+    for (i=0; i < textlen; i++){
+        if (i >= window) score_state(lid, ring[i % window], lp, -1.0);
+        s = (*lid->tk_nextmove)[s][(unsigned char) text[i]];
+        ring[i % window] = s;
+        score_state(lid, s, lp, 1.0);
+
+        if (i < window - 1) continue;
+
+        lang = (*lid->nb_classes)[logprob_to_pred(lid, lp)];
+        centre = (i == textlen - 1) ? i : i - window / 2;
+        if ((err = label_bytes(text, labelled, centre, lang, spans, &n, &cap)) != LANGID_OK) {
+            free(*spans);
+            *spans = NULL;
+            n = 0;
+            break;
+        }
+        labelled = centre + 1;
+    }
+
+    free(ring);
+    *num_spans = n;
+    return err;
+}
+
+const char *identify(LanguageIdentifier *lid, char *text, int textlen){
+    return langid_identify_with_logprob(lid, text, textlen, NULL);
+}
+
+/* Score text into logprob, which has room for lid->num_langs entries, and
+ * return the index of the predicted language.
+ */
+static int text_to_pred(LanguageIdentifier *lid, char *text, int textlen, double logprob[]){
     int pred;
 #ifdef DEBUG
 		int i;
 #endif
 
-    text_to_fv(lid, text, textlen, lid->sv, lid->fv);
-    fv_to_logprob(lid, lid->fv, lp);
-		pred = logprob_to_pred(lid,lp);
+    if (textlen < lid->direct_threshold)
+        text_to_logprob_direct(lid, text, textlen, logprob);
+    else if (lid->builtin_model) {
+        text_to_fv_builtin(lid, text, textlen, lid->sv, lid->fv);
+        fv_to_logprob_builtin(lid, lid->fv, logprob);
+    }
+    else {
+        text_to_fv(lid, text, textlen, lid->sv, lid->fv);
+        fv_to_logprob(lid, lid->fv, logprob);
+    }
+		pred = logprob_to_pred(lid,logprob);
 
 #ifdef DEBUG
-		fprintf(stderr,"pred lang: %s logprob: %lf\n", (*lid->nb_classes)[pred], lp[pred]);
+		fprintf(stderr,"pred lang: %s logprob: %lf\n", (*lid->nb_classes)[pred], logprob[pred]);
 		for (i=0; i<lid->num_langs; i++){
-			fprintf(stderr,"  lang: %s logprob: %lf\n", (*lid->nb_classes)[i], lp[i]);
+			fprintf(stderr,"  lang: %s logprob: %lf\n", (*lid->nb_classes)[i], logprob[i]);
 		}
 #endif
 
+    return pred;
+}
+
+/* As identify(), additionally storing the log-probability of the predicted
+ * language in logprob if it is not NULL.
+ */
+const char *langid_identify_with_logprob(LanguageIdentifier *lid, char *text, int textlen, double *logprob){
+    double score;
+    int pred;
+    uint64_t key = 0;
+
+    if (lid->cache != NULL) {
+        key = langid_hash_bytes(text, textlen, lid->model_id);
+        if (langid_cache_lookup(lid->cache, key, textlen, &pred, &score)) {
+            if (logprob != NULL) *logprob = score;
+            return (*lid->nb_classes)[pred];
+        }
+    }
+
+    /* the in-built model's scores fit a buffer of constant size; only loaded
+     * models need one sized at run time
+     */
+    if (lid->builtin_model) {
+        double lp[NUM_LANGS];
+        pred = text_to_pred(lid, text, textlen, lp);
+        score = lp[pred];
+    }
+    else {
+        double lp[lid->num_langs];
+        pred = text_to_pred(lid, text, textlen, lp);
+        score = lp[pred];
+    }
+
+    if (lid->cache != NULL)
+        langid_cache_insert(lid->cache, key, textlen, pred, score);
+    if (logprob != NULL)
+        *logprob = score;
+
     return (*lid->nb_classes)[pred];
 }
 
@@ -1,39 +1,73 @@
 #ifndef _LANGID_H
 #define _LANGID_H
 
-#include "sparseset.h"
-#include "langid.pb-c.h"
+#include <stddef.h>
 
-/* Structure containing all the state required to
- * implement a language identifier
+/* Version of the library interface. The major version changes whenever
+ * the ABI changes incompatibly; the minor version when it is extended.
  */
-typedef struct {
-    unsigned int num_feats;
-    unsigned int num_langs;
-    unsigned int num_states;
+#define LANGID_VERSION_MAJOR 1
+#define LANGID_VERSION_MINOR 0
 
-    unsigned (*tk_nextmove)[][256];
-    unsigned (*tk_output_c)[];
-    unsigned (*tk_output_s)[];
-    unsigned (*tk_output)[];
+/* Error codes returned by the library */
+#define LANGID_OK 0
+#define LANGID_ENOMEM (-1)  /* memory allocation failed */
+#define LANGID_EOPEN (-2)   /* model file could not be opened or read */
+#define LANGID_EMODEL (-3)  /* model file is malformed or inconsistent */
+#define LANGID_EINVAL (-4)  /* invalid argument */
 
-    double (*nb_pc)[];
-    double (*nb_ptc)[];
+/* Capabilities reported by langid_capabilities() */
+#define LANGID_CAP_BUILTIN_MODEL 0x1  /* get_default_identifier() has a model */
+#define LANGID_CAP_LOAD_MODEL 0x2     /* load_identifier() accepts pmodel files */
+#define LANGID_CAP_CACHE 0x4          /* langid_cache_create() */
+#define LANGID_CAP_SPANS 0x8          /* langid_identify_spans() */
+#define LANGID_CAP_REPLICATE 0x10     /* langid_replicate_identifier() */
 
-    char *(*nb_classes)[];
+/* Opaque handle to a language identifier. A handle must not be used by
+ * more than one thread at a time; threads should each create their own.
+ */
+typedef struct LanguageIdentifier LanguageIdentifier;
 
-    Langid__LanguageIdentifier *protobuf_model;
+/* Opaque handle to a cache of identification results. Unlike identifiers, a
+ * cache may be shared by any number of identifiers, in any threads, and it
+ * keeps results for different models apart. It must outlive the identifiers
+ * it is enabled on.
+ */
+typedef struct LangidResultCache LangidResultCache;
 
-    /* sparsesets for counting states and features. these are
-     * part of LanguageIdentifier as the clear operation on them
-     * is much less costly than allocating them from scratch
-     */
-		Set *sv, *fv;
-} LanguageIdentifier;
+/* A run of bytes in a document identified as a single language */
+typedef struct {
+    int start;
+    int len;
+    const char *lang;
+} LangidSpan;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int langid_version(void);
+extern unsigned langid_capabilities(void);
+extern const char *langid_strerror(int);
 
 extern LanguageIdentifier *get_default_identifier(void);
-extern LanguageIdentifier *load_identifier(char*);
+extern LanguageIdentifier *load_identifier(const char*);
+extern LanguageIdentifier *langid_load_identifier(const char*, int*);
+extern LanguageIdentifier *langid_replicate_identifier(const LanguageIdentifier*, int*);
 extern void destroy_identifier(LanguageIdentifier*);
+extern int langid_num_langs(const LanguageIdentifier*);
+extern const char *langid_lang(const LanguageIdentifier*, int);
+extern LangidResultCache *langid_cache_create(size_t, int*);
+extern void langid_cache_destroy(LangidResultCache*);
+extern int langid_enable_cache(LanguageIdentifier*, LangidResultCache*);
+extern int langid_cache_stats(LangidResultCache*, unsigned long*, unsigned long*);
+extern int langid_set_direct_threshold(LanguageIdentifier*, int);
 extern const char *identify(LanguageIdentifier*, char*, int);
+extern const char *langid_identify_with_logprob(LanguageIdentifier*, char*, int, double*);
+extern int langid_identify_spans(LanguageIdentifier*, char*, int, int, LangidSpan**, int*);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
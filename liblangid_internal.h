@@ -0,0 +1,68 @@
+#ifndef _LANGID_INTERNAL_H
+#define _LANGID_INTERNAL_H
+
+#include "liblangid.h"
+#include "sparseset.h"
+#include "cache.h"
+#include "langid.pb-c.h"
+
+/* Default length in bytes below which texts are scored directly. With the
+ * bundled langid.py model at -Os, direct scoring is no faster than the
+ * sparse sets from 256 bytes up, so only short texts are scored directly.
+ * Tune for a given model and machine with the -t option of the
+ * command-line driver.
+ */
+#define DIRECT_THRESHOLD 128
+
+/* Structure containing all the state required to
+ * implement a language identifier. This layout is private to the library;
+ * callers only ever see an opaque LanguageIdentifier pointer.
+ */
+struct LanguageIdentifier {
+    unsigned int num_feats;
+    unsigned int num_langs;
+    unsigned int num_states;
+
+    const unsigned (*tk_nextmove)[][256];
+    const unsigned (*tk_output_c)[];
+    const unsigned (*tk_output_s)[];
+    const unsigned (*tk_output)[];
+
+    const double (*nb_pc)[];
+    const double (*nb_ptc)[];
+
+    const char *const (*nb_classes)[];
+
+    /* set when the tables are those of the in-built model or a replica of
+     * them, which selects scoring code specialized to its dimensions
+     */
+    int builtin_model;
+
+    Langid__LanguageIdentifier *protobuf_model;
+
+    /* block holding the model tables of an identifier made by
+     * langid_replicate_identifier, owned by it
+     */
+    void *replica;
+
+    /* sparsesets for counting states and features. these are
+     * part of LanguageIdentifier as the clear operation on them
+     * is much less costly than allocating them from scratch
+     */
+		Set *sv, *fv;
+
+    /* texts shorter than this are scored without the sparsesets */
+    int direct_threshold;
+
+    /* optional cache of results for previously seen inputs, which may be
+     * shared with other identifiers. it is not owned by the identifier.
+     */
+    LangidResultCache *cache;
+
+    /* fingerprint of the model, used to seed cache keys so that identifiers
+     * with different models can share a cache. 0 for the in-built model.
+     */
+    uint64_t model_id;
+};
+
+#endif
@@ -9,30 +9,34 @@
 #include <stdlib.h>
 #include "sparseset.h"
 
-Set *alloc_set(size_t size){
+Set *langid_set_alloc(size_t size){
     Set *s;
-    if ( (void *)(s = (Set *) malloc(sizeof(Set))) == 0 ) exit(-1);
+    if ( (void *)(s = (Set *) malloc(sizeof(Set))) == 0 ) return NULL;
 
     s->members=0;
-    if ( (void *)(s->sparse = (unsigned *) malloc(size * sizeof(unsigned))) == 0 ) exit(-1);
-    if ( (void *)(s->dense  = (unsigned *) malloc(size * sizeof(unsigned))) == 0 ) exit(-1);
-    if ( (void *)(s->counts = (unsigned *) malloc(size * sizeof(unsigned))) == 0 ) exit(-1);
+    s->sparse = (unsigned *) malloc(size * sizeof(unsigned));
+    s->dense  = (unsigned *) malloc(size * sizeof(unsigned));
+    s->counts = (unsigned *) malloc(size * sizeof(unsigned));
+    if ( s->sparse == 0 || s->dense == 0 || s->counts == 0 ) {
+        langid_set_free(s);
+        return NULL;
+    }
 
     return s;
 }
 
-void free_set(Set * s){
+void langid_set_free(Set * s){
     free(s->sparse);
     free(s->dense);
     free(s->counts);
     free(s);
 }
 
-void clear(Set *s) {
+void langid_set_clear(Set *s) {
     s->members = 0;
 } 
 
-unsigned get(Set *s, unsigned key) {
+unsigned langid_set_get(Set *s, unsigned key) {
     unsigned index = s->sparse[key];
     if (index < s->members && s->dense[index] == key) {
         return s->counts[index];
@@ -42,7 +46,7 @@ unsigned get(Set *s, unsigned key) {
     }
 }
 
-void add(Set *s, unsigned key, unsigned val){
+void langid_set_add(Set *s, unsigned key, unsigned val){
     unsigned index = s->sparse[key];
     if (index < s->members && s->dense[index] == key) {
         s->counts[index] += val;
@@ -9,9 +9,9 @@ typedef struct {
     unsigned *counts;
 } Set;
 
-extern Set *alloc_set(size_t size);
-extern void free_set(Set *s);
-extern void clear(Set *s);
-extern void add(Set *s, unsigned key, unsigned val);
+extern Set *langid_set_alloc(size_t size);
+extern void langid_set_free(Set *s);
+extern void langid_set_clear(Set *s);
+extern void langid_set_add(Set *s, unsigned key, unsigned val);
 
 #endif